@@ -0,0 +1,519 @@
+import asyncio
+import ctypes
+import os
+import queue
+import threading
+import time
+import weakref
+
+from NVXDevice import NVXDataModel, NVX_ERR_OK
+from NVXSpill import NVXSpill
+
+
+# кольцевой буфер кадров одного устройства: пишет только поток чтения, читает только цикл событий.
+# С файлом подкачки (NVXSpill) кадры сверх верхней границы заполнения уходят на диск сегментом
+# [spill_begin, spill_stop), а потребитель получает их в порядке Counter: кадры буфера до сегмента,
+# кадры сегмента из памяти упреждающего чтения файла, затем кадры буфера после сегмента
+class NVXRing:
+    def __init__(self, capacity, profile=None, spill=None, high_water=0.75):
+        self.capacity = capacity  # ёмкость буфера, кадров
+        # с профилем реального времени буфер заранее отображён и заблокирован в памяти
+        self.buffer = profile.allocate(NVXDataModel, capacity) if profile else (NVXDataModel * capacity)()
+        self.write_pos = 0  # сколько кадров всего получено от библиотеки (двигает только поток чтения)
+        self.read_pos = 0  # сколько кадров всего прочитано (двигает только потребитель)
+        self.full_events = 0  # сколько раз буфер оказался заполнен и чтение из библиотеки было пропущено
+        self.block = 1  # размер блока потребителя, кадров (задаёт stream())
+        self.spill = spill  # NVXSpill или None
+        self.spill_begin = None  # номер первого кадра сегмента в файле (None - файл не используется)
+        self.spill_stop = None  # номер кадра, с которого кадры снова идут в буфер (None - сегмент ещё пишется)
+        self._lock = threading.Lock()  # смена сегмента и его чтение потребителем
+        self._high_water = int(capacity * high_water)  # заполнение, с которого кадры уходят в файл
+        # в буфер возвращаемся, когда потребитель дочитал кадры буфера до сегмента и в файле осталось меньше
+        self._low_water = capacity - self._high_water
+        self.metrics = {'spill_events': 0,  # сколько раз начиналась запись в файл
+                        'spilled_frames': 0,  # кадров записано в файл
+                        'recovered_frames': 0,  # кадров прочитано обратно из файла
+                        'spill_lost_frames': 0,  # кадров сегмента, пропущенных потребителем из-за ошибки диска
+                        'spill_pool_full': 0}  # опросов пропущено, потому что все блоки ждут записи на диск
+
+    def available(self):
+        with self._lock:
+            write_pos = self.write_pos
+            if self.spill_begin is not None:
+                # кадры буфера до сегмента доступны сразу, кадры сегмента - по мере упреждающего чтения
+                ready = max(self.spill_begin, self.spill.ready_end)
+                if self.spill_stop is None or ready < self.spill_stop:
+                    write_pos = ready
+        return write_pos - self.read_pos
+
+    def fill(self, device) -> int:
+        with self._lock:
+            failed = self.spill is not None and self.spill.error is not None
+            if self.spill_begin is not None:
+                if self.spill_stop is None:
+                    # после ошибки диска сегмент закрывается сразу, новые кадры снова идут в буфер
+                    if failed or self.read_pos >= self.spill_begin and \
+                            self.write_pos - self.read_pos < max(self.block, self._low_water):
+                        self.spill_stop = self.write_pos
+                elif self.read_pos >= self.spill_stop:
+                    # потребитель дочитал сегмент - файл больше не используется
+                    self.spill_begin = self.spill_stop = None
+
+            if self.spill_begin is None and self.spill is not None and not failed and \
+                    self.write_pos - self.read_pos >= self._high_water:
+                self.spill_begin = self.write_pos
+                self.spill.begin(self.write_pos)
+                self.metrics['spill_events'] += 1
+
+            spilling = self.spill_begin is not None and self.spill_stop is None
+            # пока потребитель читает сегмент, в буфере лежат только кадры после него. Сегмент, закрытый
+            # ошибкой диска, может закрыться раньше, чем потребитель дочитал кадры буфера перед ним
+            ring_begin = self.read_pos
+            if self.spill_stop is not None and self.read_pos >= self.spill_begin:
+                ring_begin = max(self.read_pos, self.spill_stop)
+
+        if spilling:
+            return self._fill_spill(device)
+
+        # читаем данные библиотеки прямо в свободную непрерывную часть буфера, без промежуточных копий
+        free = self.capacity - (self.write_pos - ring_begin)
+        if free == 0:
+            # данные остаются во внутреннем буфере библиотеки (около 4 секунд)
+            self.full_events += 1
+            return 0
+
+        offset = self.write_pos % self.capacity
+        frames = device.get_data(self.buffer, offset, min(free, self.capacity - offset))
+        self.write_pos += frames
+        return frames
+
+    def close_segment(self):
+        # вызывается потоком чтения после остановки устройства: новых кадров не будет, сегмент заканчивается на них
+        with self._lock:
+            if self.spill_begin is not None and self.spill_stop is None:
+                self.spill_stop = self.write_pos
+
+    def skip_failed(self, n):
+        # Функция вызывается потребителем, когда в буфере меньше n кадров. Если следующие кадры сегмента потеряны
+        # из-за ошибки диска, пропускает их до конца сегмента и возвращает эту ошибку, иначе возвращает None
+        spill = self.spill
+        if spill is None or not spill.exhausted():
+            return None
+
+        with self._lock:
+            # конец сегмента задаёт поток чтения (на следующем опросе или при остановке)
+            if self.spill_begin is None or self.spill_stop is None:
+                return None
+            if self.read_pos + n <= max(self.spill_begin, spill.ready_end) or self.read_pos >= self.spill_stop:
+                return None
+            self.metrics['spill_lost_frames'] += self.spill_stop - self.read_pos
+            self.read_pos = self.spill_stop
+
+        return spill.error
+
+    def _fill_spill(self, device) -> int:
+        try:
+            index = self.spill.free.get_nowait()
+        except queue.Empty:
+            # диск не успевает, данные пока остаются во внутреннем буфере библиотеки
+            self.metrics['spill_pool_full'] += 1
+            return 0
+
+        frames = device.get_data(self.spill.chunks[index])
+        if frames == 0:
+            self.spill.free.put(index)
+            return 0
+
+        self.write_pos += frames
+        self.metrics['spilled_frames'] += frames
+        self.spill.put(index, frames, self.write_pos)
+        # потребителя разбудит поток файла, когда кадры будут прочитаны обратно в память
+        return 0
+
+    def take(self, block):
+        # копируем len(block) кадров в block: из буфера до сегмента, из файла, из буфера после сегмента
+        count = len(block)
+        with self._lock:
+            spill_begin, spill_stop = self.spill_begin, self.spill_stop
+
+        done = count if spill_begin is None else min(count, max(0, spill_begin - self.read_pos))
+        self._copy(block, 0, self.read_pos, done)
+
+        if done < count and spill_begin is not None:
+            end = self.read_pos + count if spill_stop is None else spill_stop
+            spilled = min(count - done, max(0, end - (self.read_pos + done)))
+            if spilled:
+                self.spill.take(block, done, self.read_pos + done, spilled)
+                self.metrics['recovered_frames'] += spilled
+                done += spilled
+
+        self._copy(block, done, self.read_pos + done, count - done)
+        self.read_pos += count
+
+    def _copy(self, block, first, position, count):
+        # count кадров буфера, начиная с кадра position, в block (с кадра first) с учётом перехода через конец
+        if count <= 0:
+            return
+        size = ctypes.sizeof(NVXDataModel)
+        offset = position % self.capacity
+        part = min(count, self.capacity - offset)
+        ctypes.memmove(ctypes.byref(block, first * size), ctypes.byref(self.buffer, offset * size), part * size)
+        if count > part:
+            ctypes.memmove(ctypes.byref(block, (first + part) * size), self.buffer, (count - part) * size)
+
+
+# будит цикл событий из потока чтения: через eventfd, если цикл умеет за ним следить, иначе call_soon_threadsafe
+class _LoopNotifier:
+    def __init__(self, loop):
+        self.loop = loop
+        self.devices = set()  # AsyncNVX36, чьи потребители работают в этом цикле событий
+        self._fd = None
+
+        if hasattr(os, 'eventfd'):
+            fd = os.eventfd(0, os.EFD_NONBLOCK | os.EFD_CLOEXEC)
+            try:
+                loop.add_reader(fd, self._on_event)
+                self._fd = fd
+            except NotImplementedError:
+                # ProactorEventLoop (Windows) не умеет следить за дескрипторами
+                os.close(fd)
+
+    def is_closed(self):
+        return self.loop.is_closed()
+
+    def notify(self):
+        # вызывается из потока чтения
+        if self.is_closed():
+            raise RuntimeError('event loop is closed')
+        if self._fd is not None:
+            os.eventfd_write(self._fd, 1)
+        else:
+            self.loop.call_soon_threadsafe(self._on_event)
+
+    def _on_event(self):
+        if self._fd is not None:
+            try:
+                os.eventfd_read(self._fd)
+            except BlockingIOError:
+                pass
+
+        for device in self.devices:
+            device._wake()
+
+    def close(self):
+        if self._fd is not None:
+            if not self.loop.is_closed():
+                self.loop.remove_reader(self._fd)
+            os.close(self._fd)
+            self._fd = None
+
+
+_notifiers = {}  # цикл событий -> _LoopNotifier
+
+
+# общий для всех устройств поток: выполняет вызовы библиотеки и опрашивает устройства в режиме мониторинга
+class NVXReader(threading.Thread):
+    def __init__(self, interval=0.002, profile=None):
+        super().__init__(name='NVXReader', daemon=True)
+        self._interval = interval  # пауза между опросами устройств, с
+        self._profile = profile  # NVXRealtimeProfile или None
+        self.metrics = {'polls': 0,  # количество опросов устройств
+                        'max_poll_interval': 0.0}  # наибольший интервал между опросами, с
+        self._commands = queue.SimpleQueue()  # вызовы библиотеки от циклов событий
+        # AsyncNVX36 в режиме мониторинга; кортеж заменяется целиком при add/remove, поэтому опрос обходит его
+        # без копии
+        self._devices = ()
+        self._woken = set()  # циклы событий, которые нужно разбудить после опроса (очищается, а не создаётся)
+
+    def call(self, loop, function, *args):
+        # Функция ставит вызов в очередь потока чтения и возвращает future с его результатом
+        future = loop.create_future()
+        self._commands.put((future, function, args))
+        return future
+
+    def run(self):
+        if self._profile:
+            self._profile.apply_reader()
+
+        last = time.perf_counter()
+        while True:
+            self._execute_commands()
+
+            now = time.perf_counter()
+            self.metrics['polls'] += 1
+            self.metrics['max_poll_interval'] = max(self.metrics['max_poll_interval'], now - last)
+            last = now
+
+            profile = self._profile if self._devices else None
+            if profile:
+                profile.poll_begin()
+            notifiers = self._woken
+            for device in self._devices:
+                try:
+                    frames = device.ring.fill(device.device)
+                except Exception as error:
+                    # сбойное устройство снимаем с опроса, чтобы не остановить остальные
+                    print('[ERROR] data reading failed:', error)
+                    self._unregister(device)
+                    notifiers.add(device.notifier)
+                    continue
+                if frames > 0:
+                    notifiers.add(device.notifier)
+            if profile:
+                profile.poll_end()
+
+            # один сигнал на цикл событий за опрос, сколько бы устройств ни получили данные
+            for notifier in notifiers:
+                self._notify(notifier)
+            notifiers.clear()
+
+            time.sleep(self._interval)
+
+    def _execute_commands(self):
+        while True:
+            try:
+                future, function, args = self._commands.get_nowait()
+            except queue.Empty:
+                return
+
+            try:
+                result = function(*args)
+            except Exception as error:
+                callback, value = _set_exception, error
+            else:
+                callback, value = _set_result, result
+
+            try:
+                future.get_loop().call_soon_threadsafe(callback, future, value)
+            except RuntimeError as error:
+                # цикл событий, ждавший результата, уже закрыт
+                print('[ERROR] result was not delivered, event loop is closed:', error)
+
+    def _notify(self, notifier):
+        # ошибка одного цикла событий (закрыт цикл или eventfd) не должна остановить общий поток чтения
+        try:
+            notifier.notify()
+        except (RuntimeError, OSError, AttributeError) as error:
+            print('[ERROR] event loop is not available, its devices are no longer polled:', error)
+            self._drop(notifier)
+
+    def _unregister(self, device):
+        if device in self._devices:
+            self._devices = tuple(polled for polled in self._devices if polled is not device)
+            if device.profile is not None:
+                device.profile.on_stop()
+            # новых кадров не будет: сегмент файла подкачки заканчивается на последнем полученном кадре
+            device.ring.close_segment()
+            # stream() дочитывает оставшиеся кадры и завершается только после настоящей остановки
+            device.stopped = True
+        device.running = False
+
+    def _drop(self, notifier):
+        # снимаем с опроса и останавливаем устройства, чьи потребители больше не могут получить данные
+        for device in self._devices:
+            if device.notifier is notifier:
+                self._unregister(device)
+                device.device.stop()
+
+        # у закрытого цикла событий освобождаем и eventfd
+        if notifier is not None and notifier.is_closed():
+            _notifiers.pop(notifier.loop, None)
+            notifier.close()
+
+    def add(self, device):
+        # повторный start() уже запущенного устройства ничего не делает, иначе оно опрашивалось бы дважды
+        if device in self._devices:
+            return NVX_ERR_OK
+
+        # профиль устройства применяется к общему потоку чтения, если у потока ещё нет своего профиля
+        profile = device.profile
+        if profile is not None and profile is not self._profile:
+            if self._profile is not None:
+                raise RuntimeError('the shared reader already uses another real-time profile')
+            self._profile = profile
+            profile.apply_reader()
+
+        res = device.device.start()
+        if res == NVX_ERR_OK:
+            if profile is not None:
+                profile.on_start()
+            device.running = True
+            device.stopped = False
+            self._devices += (device,)
+        return res
+
+    def remove(self, device):
+        self._unregister(device)
+        res = device.device.stop()
+        # будим потребителей, чтобы stream() завершился
+        self._notify(device.notifier)
+        return res
+
+
+def _set_result(future, result):
+    if not future.cancelled():
+        future.set_result(result)
+
+
+def _set_exception(future, error):
+    if not future.cancelled():
+        future.set_exception(error)
+
+
+_reader = None
+_reader_lock = threading.Lock()
+
+
+def get_reader():
+    # общий поток чтения создаётся при первом обращении, профиль реального времени применяется при start()
+    global _reader
+    with _reader_lock:
+        if _reader is None:
+            _reader = NVXReader()
+            _reader.start()
+        return _reader
+
+
+# asyncio-интерфейс к открытому устройству NVX36
+class AsyncNVX36:
+    def __init__(self, device, capacity=32768, reader=None, profile=None, spill=False, spill_dir=None,
+                 high_water=0.75):
+        self.device = device  # открытое и настроенное NVX36
+        # spill=True - кадры сверх high_water * capacity уходят во временный файл в spill_dir, а не теряются
+        self._spill = NVXSpill(self._on_spill_ready, capacity, directory=spill_dir, profile=profile) if spill else None
+        self.ring = NVXRing(capacity, profile, self._spill, high_water)
+        self.running = False  # устройство в режиме мониторинга (меняет поток чтения)
+        self.stopped = False  # мониторинг был остановлен после start() (меняет поток чтения)
+        self.profile = profile  # NVXRealtimeProfile или None
+        self.notifier = None
+        self._reader = reader if reader is not None else get_reader()
+        self._loop = None
+        self._waiter = None  # future, которую ждёт stream(), пока в буфере не хватает кадров
+        self._want = 0  # сколько кадров ждёт stream()
+        self._stream_ref = None  # weakref на генератор текущего потребителя stream()
+        self._stream_token = None  # метка текущего потребителя (генератор освобождает место только своё)
+
+    def _attach(self):
+        loop = asyncio.get_running_loop()
+        if self._loop is None:
+            self._loop = loop
+            self.notifier = _notifiers.get(loop)
+            if self.notifier is None:
+                self.notifier = _notifiers[loop] = _LoopNotifier(loop)
+            self.notifier.devices.add(self)
+        elif self._loop is not loop:
+            raise RuntimeError('AsyncNVX36 is bound to another event loop')
+        return loop
+
+    def _call(self, function, *args):
+        return self._reader.call(self._attach(), function, *args)
+
+    async def start(self):
+        return await self._call(self._reader.add, self)
+
+    async def stop(self):
+        if self.profile is not None and self.running:
+            self.profile.before_stop()
+        return await self._call(self._reader.remove, self)
+
+    async def start_impedance(self):
+        return await self._call(self.device.start_impedance)
+
+    async def stop_impedance(self):
+        return await self._call(self.device.stop_impedance)
+
+    async def impedance(self, count=32):
+        return await self._call(self.device.get_impedance, count)
+
+    def stream(self, n, block=None):
+        # асинхронный генератор блоков по n кадров (массивы NVXDataModel), завершается после stop().
+        # Может быть создан до start(): тогда ждёт первых кадров.
+        # block - заранее выделенный массив NVXDataModel * n (например, profile.allocate(NVXDataModel, n)):
+        # тогда каждый раз возвращается он же со следующими кадрами и после NVXStart память не выделяется
+        if n > self.ring.capacity:
+            raise ValueError('block size is larger than the ring capacity')
+        if block is not None and len(block) != n:
+            raise ValueError('block length must be equal to n')
+
+        # кадры читаются из общего буфера, поэтому потребитель у устройства может быть только один.
+        # Место занято, пока жив генератор: после break из async for оно освобождается вместе с ним,
+        # а генератор, сохранённый в переменной, нужно закрыть через aclose()
+        if self._stream_ref is not None and self._stream_ref() is not None:
+            raise RuntimeError('stream() is already active on this device')
+
+        token = self._stream_token = object()
+        generator = self._stream(n, block, token)
+        self._stream_ref = weakref.ref(generator)
+        return generator
+
+    async def _stream(self, n, block, token):
+        loop = self._attach()
+        self.ring.block = n
+        try:
+            while True:
+                if self.ring.available() >= n:
+                    out = block if block is not None else (NVXDataModel * n)()
+                    self.ring.take(out)
+                    yield out
+                    continue
+
+                # кадры сегмента потеряны из-за ошибки диска: потребитель получает ошибку, а не ждёт их вечно.
+                # Следующий stream() продолжит с кадров после сегмента (с разрывом Counter)
+                error = self.ring.skip_failed(n)
+                if error is not None:
+                    raise error
+
+                # после остановки дочитываем и кадры, которые ещё записываются в файл
+                if self.stopped and self.ring.write_pos - self.ring.read_pos < n:
+                    return
+
+                self._want = n
+                waiter = self._waiter = loop.create_future()
+                try:
+                    await waiter
+                finally:
+                    if self._waiter is waiter:
+                        self._waiter = None
+        finally:
+            # брошенный генератор закрывается позже, когда место может занимать уже новый потребитель
+            if self._stream_token is token:
+                self._stream_ref = self._stream_token = None
+
+    def _on_spill_ready(self):
+        # вызывается из потока файла: ошибка цикла событий не должна остановить запись на диск
+        notifier = self.notifier
+        if notifier is None:
+            return
+        try:
+            notifier.notify()
+        except (RuntimeError, OSError, AttributeError) as error:
+            print('[ERROR] event loop is not available, spilled frames are not delivered:', error)
+
+    def get_metrics(self):
+        metrics = dict(self.ring.metrics)
+        metrics['full_events'] = self.ring.full_events
+        if self.ring.spill is not None:
+            metrics['spill_unwritten_frames'] = self.ring.spill.unwritten_frames
+        return metrics
+
+    def _wake(self):
+        if self._waiter is None or self._waiter.done():
+            return
+        failed = self._spill is not None and self._spill.error is not None
+        if self.ring.available() >= self._want or self.stopped or failed:
+            self._waiter.set_result(None)
+
+    def close(self):
+        # отвязываемся от цикла событий и удаляем файл подкачки (устройство должно быть остановлено)
+        if self.running:
+            raise RuntimeError('device is running, await stop() before close()')
+        if self._spill is not None:
+            self._spill.close()
+            self._spill = None
+        if self.notifier is not None:
+            self.notifier.devices.discard(self)
+            if not self.notifier.devices:
+                self.notifier.close()
+                _notifiers.pop(self._loop, None)
+        self.notifier = None
+        self._loop = None
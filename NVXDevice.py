@@ -1,4 +1,5 @@
 import ctypes
+import time
 
 # C error numbers
 NVX_ERR_OK = 0  # успешное выполнение функции
@@ -23,17 +24,15 @@ class NVXInformation(ctypes.Structure):
             ('wSecond', ctypes.c_int16),
             ('wMilliseconds', ctypes.c_int16)]
 
-    _pack_ = 1
     _fields_ = [
-        ('Model', ctypes.c_uint16),
-        ('SerialNumber', ctypes.c_uint16),
+        ('Model', ctypes.c_uint32),
+        ('SerialNumber', ctypes.c_uint32),
         ('Date', SYSTEMTIME)
     ]
 
 
 # структура данных для сохранения информации об основных параметрах записи устройства
 class NVXProperty(ctypes.Structure):
-    _pack_ = 1
     _fields_ = [
         ('RateEeg', ctypes.c_float),
         ('RateAux', ctypes.c_float),
@@ -48,23 +47,23 @@ class NVXProperty(ctypes.Structure):
 class NVXPossibility(ctypes.Structure):
     _pack_ = 1
     _fields_ = [
-        ('EegChannelsCount', ctypes.c_uint16),
-        ('AuxChannelsCount', ctypes.c_uint16),
-        ('InTriggersCount', ctypes.c_uint16),
-        ('OutTriggersCount', ctypes.c_uint16),
-        ('XDisplayResolution', ctypes.c_uint16),
-        ('YDisplayResolution', ctypes.c_uint16),
-        ('UserMemorySize', ctypes.c_uint16)
+        ('EegChannelsCount', ctypes.c_uint32),
+        ('AuxChannelsCount', ctypes.c_uint32),
+        ('InTriggersCount', ctypes.c_uint32),
+        ('OutTriggersCount', ctypes.c_uint32),
+        ('XDisplayResolution', ctypes.c_uint32),
+        ('YDisplayResolution', ctypes.c_uint32),
+        ('UserMemorySize', ctypes.c_uint32)
     ]
 
 
 class NVXFrequencyBandwidth(ctypes.Structure):
     _pack_ = 1
     _fields_ = [
-        ('SampleRate', ctypes.c_uint16),
-        ('CutoffFreq', ctypes.c_uint16),
-        ('DecimFromRate', ctypes.c_uint16),
-        ('Decimation', ctypes.c_uint16)
+        ('SampleRate', ctypes.c_uint32),
+        ('CutoffFreq', ctypes.c_uint32),
+        ('DecimFromRate', ctypes.c_uint32),
+        ('Decimation', ctypes.c_uint32)
     ]
 
 
@@ -123,49 +122,70 @@ class NVXDataSettings(ctypes.Structure):
     ]
 
 
+# структура одного отсчёта (кадра) данных устройства NVX-36 в нормальном режиме
 class NVXDataModel(ctypes.Structure):
     _pack_ = 1
-    _fields_ = [[(f'Data{i}', ctypes.c_int16) for i in range(1, 33)].extend(
-        [(f'Aux{1}', ctypes.c_int16) for i in range(1, 5)])].extend([
-        ('Status', ctypes.c_uint16),
-        ('Counter', ctypes.c_uint16)
-    ])
+    _fields_ = [
+        ('Main', ctypes.c_int32 * 32),
+        ('Aux', ctypes.c_int32 * 4),
+        ('Status', ctypes.c_uint32),
+        ('Counter', ctypes.c_uint32)
+    ]
+
+
+# структура данных для сохранения расширенной информации о версиях библиотеки, драйвера и прошивки
+class NVXVersionExt(ctypes.Structure):
+    _fields_ = [
+        ('Dll', ctypes.c_uint64),
+        ('Driver', ctypes.c_uint64),
+        ('Dsp', ctypes.c_uint64),
+        ('Fpga', ctypes.c_uint64)
+    ]
+
+
+def load_library():
+    # пытаемся загрузить библиотеку
+    try:
+        # загружаем библиотеку для работы с NVX
+        lib = ctypes.CDLL('lib/Windows/Generic/x64/Release/nvxmcs.dll')
+    except:
+        # если библиотека загрузилась неудачно
+        print('[ERROR] failed to open library (nvxmcs.dll),', end=' ')
+        print('check the file location or the architecture version of your device (x64/x86)')
+        return None
+
+    # начинаем работу с NVX устройством
+    res = lib.NVXAPIInit()
+    if res != NVX_ERR_OK:
+        print('[ERROR] cant initialize library resources')
+
+    return lib
 
 
 class NVX36:
-    def __init__(self):
+    def __init__(self, lib=None, number=0):
         self._id = 0  # id нашего текущего устройства
-        self._data_mode = ctypes.c_uint16()  # Режим работы устройства (0 - normal, 1 - 50 kHz)
-        self._sample_rate_count = ctypes.c_uint16()  # Количество возможных частот дискретизаций устройства
+        self._number = number  # порядковый номер устройства (от 0 до NVXGetCount() - 1)
+        self._data_mode = ctypes.c_uint32()  # Режим работы устройства (0 - normal, 1 - 50 kHz)
+        self._sample_rate_count = ctypes.c_uint32()  # Количество возможных частот дискретизаций устройства
+        self.first_frame_time = None  # момент (time.perf_counter) получения первого валидного кадра данных
         # храним структуры с информацией об устройстве
         self._nvx_information = NVXInformation()
         self._nvx_property = NVXProperty()
         self._nvx_possibility = NVXPossibility()
-        self._nvx_frequency_bandwidth = NVXFrequencyBandwidth()
-
-        # пытаемся загрузить библиотеку
-        try:
-            # загружаем библиотеку для работы с NVX
-            self._lib = ctypes.CDLL('lib/Windows/Generic/x64/Release/nvxmcs.dll')
-        except:
-            # если библиотека загрузилась неудачно
-            self._lib = None
-            print('[ERROR] failed to open library (nvxmcs.dll),', end=' ')
-            print('check the file location or the architecture version of your device (x64/x86)')
-
-        # начинаем работу с NVX устройством
-        res = self._lib.NVXAPIInit()
-        if res != NVX_ERR_OK:
-            print('[ERROR] cant initialize library resources')
+        self._nvx_version_ext = NVXVersionExt()
+
+        # библиотеку можно передать уже загруженной и инициализированной (NVXSession для нескольких устройств)
+        self._lib = lib if lib is not None else load_library()
 
     def get_id(self):
         # получаем количество подключенных устройств
         device_count = self._lib.NVXGetCount()
-        if device_count < NVX_ERR_OK:
+        if device_count <= self._number:
             print('[ERROR] no devices connected')
 
-        # получаем id устройства с порядковым номером 0 (подключен только один усилитель)
-        self._id = self._lib.NVXGetId(0)
+        # получаем id устройства с заданным порядковым номером (по умолчанию 0 - подключен только один усилитель)
+        self._id = self._lib.NVXGetId(self._number)
         if self._id == 0:
             print('[ERROR] the device ID was not received')
 
@@ -177,6 +197,8 @@ class NVX36:
         elif res == NVX_ERR_FAIL:
             print('[ERROR] the device is not running, an error has occurred')
 
+        return res
+
     def close(self):
         # Функция удаляет id заданного устройства. После вызова функции использование этого id становится невозможным
         res = self._lib.NVXClose(self._id)
@@ -258,22 +280,36 @@ class NVX36:
         return self._sample_rate_count.value
 
     def get_frequency_bandwidth(self):
-        # Функция передает информацию о ширине полосы пропускания устройства
-        size = ctypes.c_uint16(self.get_sample_rate_count())
-        res = self._lib.NVXGetFrequencyBandwidth(ctypes.byref(self._nvx_frequency_bandwidth), size)
+        # Функция передает таблицу полос пропускания устройства (по одной записи на каждую частоту дискретизации)
+        count = self.get_sample_rate_count()
+        bandwidth = (NVXFrequencyBandwidth * count)()
+        res = self._lib.NVXGetFrequencyBandwidth(bandwidth, ctypes.c_uint32(ctypes.sizeof(bandwidth)))
         if res == NVX_ERR_PARAM:
             print('[ERROR] invalid parameter when calling the function get_frequency_bandwidth()')
 
-        return {'SampleRate': ctypes.pointer(self._nvx_frequency_bandwidth).contents.SampleRate,
-                'CutoffFreq': ctypes.pointer(self._nvx_frequency_bandwidth).contents.CutoffFreq,
-                'DecimFromRate': ctypes.pointer(self._nvx_frequency_bandwidth).contents.DecimFromRate,
-                'Decimation': ctypes.pointer(self._nvx_frequency_bandwidth).contents.Decimation}
+        return [{'SampleRate': item.SampleRate,
+                 'CutoffFreq': item.CutoffFreq,
+                 'DecimFromRate': item.DecimFromRate,
+                 'Decimation': item.Decimation} for item in bandwidth]
+
+    def get_version_ext(self):
+        # Функция передает расширенную информацию о версиях библиотеки, драйвера и прошивки (DSP, FPGA) устройства
+        res = self._lib.NVXGetVersionExt(self._id, ctypes.byref(self._nvx_version_ext))
+        if res == NVX_ERR_ID:
+            print('[ERROR] version not received, invalid device id')
+        elif res == NVX_ERR_PARAM:
+            print('[ERROR] invalid parameter when calling the function get_version_ext()')
+
+        return {'Dll': self._nvx_version_ext.Dll,
+                'Driver': self._nvx_version_ext.Driver,
+                'Dsp': self._nvx_version_ext.Dsp,
+                'Fpga': self._nvx_version_ext.Fpga}
 
     def set_data_mode(self, mode: int, settings: NVXDataSettings):
         # Функция предназначена для установки параметров регистрации сигнала. Не используется во время мониторинга и
         # возвращает результат NVX_ERR_FAIL (2.1). Если Mode = 0, то устройство переводится в нормальный режим
         # работы, если Mode = 1, то устройство переводится в режим работы 50 кГц.
-        res = self._lib.NVXSetDataMode(self._id, ctypes.c_uint16(mode), ctypes.byref(settings))
+        res = self._lib.NVXSetDataMode(self._id, ctypes.c_uint32(mode), ctypes.byref(settings))
         if res == NVX_ERR_FAIL:
             print('[ERROR] impossible to set parameters, recording is underway')
         elif res == NVX_ERR_ID:
@@ -290,11 +326,57 @@ class NVX36:
         if res == NVX_ERR_FAIL:
             print('[ERROR] impossible to start device')
 
+        return res
+
     def stop(self):
         # Функция выводит устройство из режима мониторинга
         res = self._lib.NVXStop(self._id)
         if res == NVX_ERR_FAIL:
             print('[ERROR] impossible to stop device')
 
-    def get_data(self):
-        res = self._lib.NVXGetData(self._id, )
+        return res
+
+    def start_impedance(self):
+        # Функция запускает измерение импеданса (устройство уже должно быть в режиме мониторинга, см. start())
+        res = self._lib.NVXStartImpedance(self._id)
+        if res == NVX_ERR_FAIL:
+            print('[ERROR] impossible to start impedance measure')
+
+        return res
+
+    def stop_impedance(self):
+        # Функция останавливает измерение импеданса, но не мониторинг
+        res = self._lib.NVXStopImpedance(self._id)
+        if res == NVX_ERR_FAIL:
+            print('[ERROR] impossible to stop impedance measure')
+
+        return res
+
+    def get_impedance(self, count=32):
+        # Функция передает импеданс (Ом) по count каналам, для неподключенного электрода значение равно INT_MAX
+        buffer = (ctypes.c_uint32 * count)()
+        res = self._lib.NVXGetImpedance(self._id, buffer, ctypes.c_uint32(ctypes.sizeof(buffer)))
+        if res == NVX_ERR_ID:
+            print('[ERROR] impedance not received, invalid device id')
+        elif res == NVX_ERR_PARAM:
+            print('[ERROR] invalid parameter when calling the function get_impedance()')
+
+        return list(buffer)
+
+    def get_data(self, buffer, offset=0, count=None) -> int:
+        # Функция копирует накопленные библиотекой кадры в buffer (массив NVXDataModel), начиная с кадра offset,
+        # но не более count кадров (по умолчанию - до конца буфера), и возвращает количество скопированных кадров
+        if count is None:
+            count = len(buffer) - offset
+        size = ctypes.sizeof(NVXDataModel)
+        res = self._lib.NVXGetData(self._id, ctypes.c_void_p(ctypes.addressof(buffer) + offset * size),
+                                   ctypes.c_uint32(count * size))
+        if res < NVX_ERR_OK:
+            print('[ERROR] data not received, error code', res)
+            return 0
+
+        # запоминаем момент прихода первого валидного кадра (метрика времени запуска)
+        if res > 0 and self.first_frame_time is None:
+            self.first_frame_time = time.perf_counter()
+
+        return res // size
@@ -0,0 +1,246 @@
+import ctypes
+import mmap
+import os
+import sys
+import tracemalloc
+
+if sys.platform != 'win32':
+    import resource
+
+# приоритет потока для Windows (аналог SCHED_FIFO)
+THREAD_PRIORITY_TIME_CRITICAL = 15
+
+# флаг отображения на больших страницах Linux (в модуле mmap есть не во всех версиях Python)
+MAP_HUGETLB = getattr(mmap, 'MAP_HUGETLB', 0x40000)
+
+# флаги mlockall (Linux x86/ARM): заблокировать текущие и все будущие страницы процесса
+MCL_CURRENT = 1
+MCL_FUTURE = 2
+
+
+# модули пути данных (поток чтения и stream()), чьи выделения памяти учитываются при trace_allocations
+TRACED_MODULES = [tracemalloc.Filter(True, '*' + os.sep + name) for name in
+                  ('NVXAsync.py', 'NVXSpill.py', 'NVXDevice.py')]
+
+
+# структура счётчиков памяти процесса Windows (GetProcessMemoryInfo)
+class PROCESS_MEMORY_COUNTERS(ctypes.Structure):
+    _fields_ = [('cb', ctypes.c_uint32),
+                ('PageFaultCount', ctypes.c_uint32),
+                ('PeakWorkingSetSize', ctypes.c_size_t),
+                ('WorkingSetSize', ctypes.c_size_t),
+                ('QuotaPeakPagedPoolUsage', ctypes.c_size_t),
+                ('QuotaPagedPoolUsage', ctypes.c_size_t),
+                ('QuotaPeakNonPagedPoolUsage', ctypes.c_size_t),
+                ('QuotaNonPagedPoolUsage', ctypes.c_size_t),
+                ('PagefileUsage', ctypes.c_size_t),
+                ('PeakPagefileUsage', ctypes.c_size_t)]
+
+
+# профиль реального времени: привязка потоков к ядрам, SCHED_FIFO и заблокированная в памяти память буферов
+class NVXRealtimeProfile:
+    def __init__(self, reader_cores=None, processing_cores=None, fifo=False, priority=50, lock_memory=True,
+                 lock_all=False, hugepages=False, trace_allocations=False):
+        self.reader_cores = reader_cores  # ядра для потока чтения (None - не привязывать)
+        self.processing_cores = processing_cores  # ядра для потоков обработки (None - не привязывать)
+        self.fifo = fifo  # SCHED_FIFO для потока чтения (Linux) / THREAD_PRIORITY_TIME_CRITICAL (Windows)
+        self.priority = priority  # приоритет SCHED_FIFO (1 - 99)
+        self.lock_memory = lock_memory  # заблокировать буферы в памяти (mlock / VirtualLock)
+        # при lock_memory заблокировать всю память процесса, включая будущую (mlockall, только Linux):
+        # кроме буферов не будет промахов и на куче интерпретатора и стеках, но нужен большой RLIMIT_MEMLOCK
+        self.lock_all = lock_all
+        self.hugepages = hugepages  # выделять буферы на больших страницах (только Linux)
+        self.trace_allocations = trace_allocations  # отслеживать выделения памяти через tracemalloc (медленно)
+        self.started = False  # устройство запущено (NVXStart): новых выделений памяти быть не должно
+        self._active = 0  # сколько устройств с этим профилем сейчас в режиме мониторинга
+        self._snapshot = None  # снимок tracemalloc в момент NVXStart
+        self._stop_snapshot = None  # снимок tracemalloc перед командой остановки
+        # показания в начале опроса; ctypes-ячейки, чтобы их запись не выделяла память во время измерения
+        self._poll_traced = ctypes.c_ssize_t()
+        self._poll_blocks = ctypes.c_ssize_t()
+        self._poll_faults = ctypes.c_ssize_t()
+        self.counters = {'allocated_bytes': 0,  # выделено памяти под буферы
+                         'locked_bytes': 0,  # из них заблокировано в памяти
+                         'hugepage_bytes': 0,  # из них на больших страницах
+                         'process_locked': False,  # вся память процесса заблокирована (mlockall)
+                         'buffer_allocations_after_start': 0,  # буферов выделено через allocate() после NVXStart
+                         'hot_path_page_faults': 0,  # страничных промахов потока чтения во время опроса
+                         # прирост числа блоков интерпретатора за опросы (sys.getallocatedblocks, всегда):
+                         # растёт, если опрос оставляет после себя объекты
+                         'poll_block_growth': 0,
+                         # по tracemalloc (только при trace_allocations). CPython выделяет память и в опросе:
+                         # аргументы ctypes в NVX36.get_data, int для счётчиков кадров. Эти счётчики показывают
+                         # такие выделения, а не скрывают их; с симулятором в них входит и сам симулятор
+                         # (настоящая библиотека выделяет память вне кучи Python и не учитывается):
+                         'poll_allocations': 0,  # опросов, во время которых выделялась память
+                         'poll_allocated_bytes_max': 0,  # наибольший объём, выделенный за один опрос
+                         # между NVXStart и командой остановки:
+                         'traced_blocks_after_start': 0,  # блоков выделено в модулях пути данных и не освобождено
+                         'traced_bytes_after_start': 0}  # их объём
+
+    def apply_reader(self):
+        # вызывается из потока чтения
+        self._set_affinity(self.reader_cores)
+        if self.fifo:
+            self._set_fifo()
+        if self.lock_memory and self.lock_all and not self.counters['process_locked']:
+            self._lock_all()
+
+    def apply_processing(self):
+        # вызывается из потока обработки (например, из потока цикла событий)
+        self._set_affinity(self.processing_cores)
+
+    def allocate(self, ctype, count):
+        # Функция выделяет массив ctype * count в отдельной анонимной памяти, заранее обращается ко всем
+        # страницам (чтобы не было промахов при первом касании) и блокирует её в памяти
+        size = ctypes.sizeof(ctype) * count
+        if self.started:
+            self.counters['buffer_allocations_after_start'] += 1
+
+        memory = None
+        if self.hugepages and sys.platform.startswith('linux'):
+            # размер должен быть кратен большой странице (2 МБ)
+            huge_size = (size + (1 << 21) - 1) & ~((1 << 21) - 1)
+            try:
+                memory = mmap.mmap(-1, huge_size, flags=mmap.MAP_PRIVATE | mmap.MAP_ANONYMOUS | MAP_HUGETLB)
+                self.counters['hugepage_bytes'] += huge_size
+            except OSError:
+                print('[ERROR] hugepages are not available, using normal pages')
+        if memory is None:
+            memory = mmap.mmap(-1, size)
+
+        array = (ctype * count).from_buffer(memory)
+        ctypes.memset(array, 0, size)
+        self.counters['allocated_bytes'] += size
+
+        if self.lock_memory:
+            if _lock(ctypes.addressof(array), size):
+                self.counters['locked_bytes'] += size
+            else:
+                print('[ERROR] failed to lock buffer in memory (not enough privileges or memory lock limit)')
+
+        return array
+
+    def on_start(self):
+        # вызывается потоком чтения после успешного NVXStart
+        self._active += 1
+        if self._active > 1:
+            return
+
+        self.started = True
+        if self.trace_allocations:
+            if not tracemalloc.is_tracing():
+                tracemalloc.start()
+            self._snapshot = tracemalloc.take_snapshot().filter_traces(TRACED_MODULES)
+
+    def before_stop(self):
+        # вызывается циклом событий до постановки команды остановки последнего устройства, чтобы в сравнение
+        # не попали выделения самой команды (future, очередь)
+        if self._snapshot is not None and self._active == 1:
+            self._stop_snapshot = tracemalloc.take_snapshot().filter_traces(TRACED_MODULES)
+
+    def on_stop(self):
+        # вызывается потоком чтения при остановке устройства
+        self._active -= 1
+        if self._active > 0:
+            return
+
+        self.started = False
+        if self._snapshot is not None:
+            snapshot = self._stop_snapshot
+            if snapshot is None:
+                # устройство снято с опроса без stop() (ошибка чтения, закрытый цикл событий)
+                snapshot = tracemalloc.take_snapshot().filter_traces(TRACED_MODULES)
+            for stat in snapshot.compare_to(self._snapshot, 'lineno'):
+                if stat.count_diff > 0:
+                    self.counters['traced_blocks_after_start'] += stat.count_diff
+                    self.counters['traced_bytes_after_start'] += max(stat.size_diff, 0)
+            self._snapshot = self._stop_snapshot = None
+
+    def poll_begin(self):
+        # вызывается потоком чтения перед опросом устройств. Показания снимаются до записи в ctypes-ячейки,
+        # временные объекты самих вызовов освобождаются до начала измерения
+        self._poll_faults.value = page_faults()
+        if self._snapshot is not None:
+            self._poll_traced.value = tracemalloc.get_traced_memory()[0]
+            tracemalloc.reset_peak()
+        self._poll_blocks.value = sys.getallocatedblocks()
+
+    def poll_end(self):
+        # вызывается потоком чтения после опроса устройств; пик tracemalloc читается первым
+        if self._snapshot is not None:
+            allocated = tracemalloc.get_traced_memory()[1] - self._poll_traced.value
+            if allocated > 0:
+                self.counters['poll_allocations'] += 1
+                self.counters['poll_allocated_bytes_max'] = max(self.counters['poll_allocated_bytes_max'], allocated)
+        growth = sys.getallocatedblocks() - self._poll_blocks.value
+        if growth > 0:
+            self.counters['poll_block_growth'] += growth
+        self.counters['hot_path_page_faults'] += page_faults() - self._poll_faults.value
+
+    def _set_affinity(self, cores):
+        if cores is None:
+            return
+
+        try:
+            if sys.platform == 'win32':
+                mask = 0
+                for core in cores:
+                    mask |= 1 << core
+                kernel32 = ctypes.windll.kernel32
+                kernel32.GetCurrentThread.restype = ctypes.c_void_p
+                if not kernel32.SetThreadAffinityMask(ctypes.c_void_p(kernel32.GetCurrentThread()),
+                                                      ctypes.c_size_t(mask)):
+                    print('[ERROR] failed to set thread affinity')
+            else:
+                # в Linux pid 0 означает текущий поток
+                os.sched_setaffinity(0, cores)
+        except OSError as error:
+            print('[ERROR] failed to set thread affinity:', error)
+
+    def _lock_all(self):
+        if not sys.platform.startswith('linux'):
+            print('[ERROR] locking all process memory is supported only on Linux')
+            return
+
+        libc = ctypes.CDLL(None, use_errno=True)
+        if libc.mlockall(MCL_CURRENT | MCL_FUTURE) == 0:
+            self.counters['process_locked'] = True
+        else:
+            print('[ERROR] mlockall failed:', os.strerror(ctypes.get_errno()))
+
+    def _set_fifo(self):
+        try:
+            if sys.platform == 'win32':
+                kernel32 = ctypes.windll.kernel32
+                kernel32.GetCurrentThread.restype = ctypes.c_void_p
+                if not kernel32.SetThreadPriority(ctypes.c_void_p(kernel32.GetCurrentThread()),
+                                                  THREAD_PRIORITY_TIME_CRITICAL):
+                    print('[ERROR] failed to set thread priority')
+            else:
+                os.sched_setscheduler(0, os.SCHED_FIFO, os.sched_param(self.priority))
+        except OSError as error:
+            print('[ERROR] failed to set SCHED_FIFO (CAP_SYS_NICE is required):', error)
+
+
+def _lock(address, size) -> bool:
+    if sys.platform == 'win32':
+        kernel32 = ctypes.windll.kernel32
+        return bool(kernel32.VirtualLock(ctypes.c_void_p(address), ctypes.c_size_t(size)))
+
+    libc = ctypes.CDLL(None, use_errno=True)
+    return libc.mlock(ctypes.c_void_p(address), ctypes.c_size_t(size)) == 0
+
+
+def page_faults():
+    # количество страничных промахов текущего потока (Linux) или всего процесса (Windows)
+    if sys.platform == 'win32':
+        counters = PROCESS_MEMORY_COUNTERS()
+        counters.cb = ctypes.sizeof(counters)
+        ctypes.windll.kernel32.GetCurrentProcess.restype = ctypes.c_void_p
+        ctypes.windll.psapi.GetProcessMemoryInfo(ctypes.c_void_p(ctypes.windll.kernel32.GetCurrentProcess()),
+                                                 ctypes.byref(counters), counters.cb)
+        return counters.PageFaultCount
+
+    usage = resource.getrusage(resource.RUSAGE_THREAD)
+    return usage.ru_minflt + usage.ru_majflt
@@ -0,0 +1,216 @@
+import ctypes
+import json
+import os
+import sys
+import threading
+import time
+from concurrent.futures import ThreadPoolExecutor
+
+from NVXDevice import NVX36, NVX_DM_NORMAL, NVX_ERR_OK, load_library
+
+
+def _process_start_time():
+    # момент старта процесса в шкале time.perf_counter (для метрики "старт процесса -> первый кадр")
+    now = time.perf_counter()
+    try:
+        if sys.platform == 'win32':
+            kernel32 = ctypes.windll.kernel32
+            kernel32.GetCurrentProcess.restype = ctypes.c_void_p
+            creation, exit_time, kernel_time, user_time = (ctypes.c_uint64() for _ in range(4))
+            if kernel32.GetProcessTimes(ctypes.c_void_p(kernel32.GetCurrentProcess()), ctypes.byref(creation),
+                                        ctypes.byref(exit_time), ctypes.byref(kernel_time), ctypes.byref(user_time)):
+                current = ctypes.c_uint64()
+                kernel32.GetSystemTimeAsFileTime(ctypes.byref(current))
+                # FILETIME считается в интервалах по 100 нс
+                return now - (current.value - creation.value) / 1e7
+        else:
+            # 22-е поле /proc/self/stat - время старта процесса в тиках с момента загрузки системы
+            with open('/proc/self/stat') as f:
+                start_ticks = int(f.read().rsplit(')', 1)[1].split()[19])
+            with open('/proc/uptime') as f:
+                uptime = float(f.read().split()[0])
+            return now - (uptime - start_ticks / os.sysconf('SC_CLK_TCK'))
+    except (OSError, ValueError, AttributeError, IndexError):
+        pass
+
+    # если время старта процесса узнать не удалось - считаем от импорта модуля
+    return now
+
+
+PROCESS_START = _process_start_time()
+
+# неизменяемые данные о возможностях устройств: SerialNumber -> {Possibility, FrequencyBandwidth, Version}
+_capability_cache = {}
+_capability_lock = threading.Lock()
+
+
+class NVXSession:
+    def __init__(self, cache_path=None, lib=None):
+        self.devices = []  # открытые устройства (NVX36) в порядке их номеров
+        self.information = []  # информация (NVXGetInformation) по каждому открытому устройству
+        self.capabilities = []  # возможности (из кэша или запрошенные у устройства) по каждому открытому устройству
+        self._cache_path = cache_path  # файл для сохранения кэша между запусками (None - кэш только в памяти)
+        self.metrics = {'api_init': 0.0,  # время инициализации библиотеки, с
+                        'discovery': 0.0,  # время поиска устройств, с
+                        'discovery_attempts': 0,  # количество вызовов NVXGetCount при поиске
+                        'open_configure': 0.0,  # время открытия и настройки всех устройств, с
+                        'cache_hits': 0,  # устройства, возможности которых взяты из кэша
+                        'cache_misses': 0,  # устройства, возможности которых пришлось запросить
+                        'cache_stale': 0}  # записи кэша, отброшенные из-за смены версий (обновление)
+
+        self._load_cache()
+
+        begin = time.perf_counter()
+        # lib - уже загруженная библиотека или её замена (например, NVXSimulator), ресурсы инициализирует сессия
+        if lib is None:
+            self._lib = load_library()
+        else:
+            self._lib = lib
+            if self._lib.NVXAPIInit() != NVX_ERR_OK:
+                print('[ERROR] cant initialize library resources')
+        self.metrics['api_init'] = time.perf_counter() - begin
+
+    def discover(self, timeout=10.0, min_delay=0.005, max_delay=0.5) -> int:
+        # Функция ждёт подключения устройств, опрашивая NVXGetCount с экспоненциально растущей паузой
+        begin = time.perf_counter()
+        delay = min_delay
+        count = 0
+        while True:
+            count = self._lib.NVXGetCount()
+            self.metrics['discovery_attempts'] += 1
+            if count > 0 or time.perf_counter() - begin >= timeout:
+                break
+            time.sleep(delay)
+            delay = min(delay * 2, max_delay)
+
+        self.metrics['discovery'] = time.perf_counter() - begin
+        if count == 0:
+            print('[ERROR] no devices connected')
+
+        return count
+
+    def open_all(self, count, mode=NVX_DM_NORMAL, settings=None, parallel=True):
+        # Функция открывает и настраивает count устройств, по умолчанию параллельно (по потоку на устройство).
+        # Устройства, которые не удалось открыть, пропускаются, остальные сохраняются в self.devices
+        begin = time.perf_counter()
+        if parallel and count > 1:
+            with ThreadPoolExecutor(max_workers=count) as pool:
+                results = list(pool.map(lambda number: self._open_device(number, mode, settings), range(count)))
+        else:
+            results = [self._open_device(number, mode, settings) for number in range(count)]
+        results = [result for result in results if result is not None]
+        self.metrics['open_configure'] = time.perf_counter() - begin
+
+        self.devices = [device for device, information, capabilities in results]
+        self.information = [information for device, information, capabilities in results]
+        self.capabilities = [capabilities for device, information, capabilities in results]
+        self._save_cache()
+
+        return self.devices
+
+    def _open_device(self, number, mode, settings):
+        # Функция возвращает (устройство, информация, возможности) или None, если устройство открыть не удалось.
+        # Исключения не выпускаются, чтобы ошибка одного устройства не потеряла остальные открытые устройства
+        device = NVX36(self._lib, number)
+        try:
+            device.get_id()
+            if device.open() != NVX_ERR_OK:
+                return None
+        except Exception as error:
+            print('[ERROR] device', number, 'was not opened:', error)
+            return None
+
+        try:
+            return self._configure_device(device, mode, settings)
+        except Exception as error:
+            # устройство уже открыто - закрываем, иначе его никто не закроет
+            print('[ERROR] device', number, 'was not configured:', error)
+            device.close()
+            return None
+
+    def _configure_device(self, device, mode, settings):
+        information = device.get_information()
+        serial = information['SerialNumber']
+        # версии библиотеки, драйвера и прошивки меняются при обновлении, поэтому запрашиваются всегда и
+        # служат проверкой записи кэша: после любого обновления возможности устройства запрашиваются заново
+        version = device.get_version_ext()
+        with _capability_lock:
+            capabilities = _capability_cache.get(serial)
+            if capabilities is not None and capabilities.get('Version') != version:
+                del _capability_cache[serial]
+                capabilities = None
+                self.metrics['cache_stale'] += 1
+            self.metrics['cache_misses' if capabilities is None else 'cache_hits'] += 1
+
+        if capabilities is None:
+            capabilities = {'Possibility': device.get_possibility(),
+                            'FrequencyBandwidth': device.get_frequency_bandwidth(),
+                            'Version': version}
+            # у непрограммированного устройства SerialNumber = 0, такие данные кэшировать нельзя
+            if serial != 0:
+                with _capability_lock:
+                    _capability_cache[serial] = capabilities
+
+        if settings is not None:
+            device.set_data_mode(mode, settings)
+
+        return device, information, capabilities
+
+    def start_all(self):
+        for device in self.devices:
+            device.start()
+
+    def stop_all(self):
+        for device in self.devices:
+            device.stop()
+
+    def close(self):
+        # закрываем все устройства и освобождаем ресурсы библиотеки
+        for device in self.devices:
+            device.close()
+        self.devices = []
+
+        res = self._lib.NVXAPIStop()
+        if res != NVX_ERR_OK:
+            print('[ERROR] cannot free library resources')
+
+    def time_to_first_frame(self):
+        # Функция возвращает время от старта процесса до первого валидного кадра (с) или None, если кадров ещё не было
+        frames = [device.first_frame_time for device in self.devices if device.first_frame_time is not None]
+        if not frames:
+            return None
+
+        return min(frames) - PROCESS_START
+
+    def get_metrics(self):
+        metrics = dict(self.metrics)
+        metrics['first_frame'] = self.time_to_first_frame()
+        return metrics
+
+    def _load_cache(self):
+        if self._cache_path is None or not os.path.exists(self._cache_path):
+            return
+
+        try:
+            with open(self._cache_path) as f:
+                cache = json.load(f)
+        except (OSError, ValueError):
+            print('[ERROR] failed to read capability cache', self._cache_path)
+            return
+
+        # ключи в json - строки, приводим обратно к SerialNumber
+        with _capability_lock:
+            for serial, capabilities in cache.items():
+                _capability_cache.setdefault(int(serial), capabilities)
+
+    def _save_cache(self):
+        if self._cache_path is None:
+            return
+
+        with _capability_lock:
+            cache = {str(serial): capabilities for serial, capabilities in _capability_cache.items()}
+        try:
+            with open(self._cache_path, 'w') as f:
+                json.dump(cache, f)
+        except OSError:
+            print('[ERROR] failed to write capability cache', self._cache_path)
@@ -0,0 +1,303 @@
+import argparse
+import asyncio
+import ctypes
+import errno
+import math
+import multiprocessing
+import os
+import sys
+import time
+
+from NVXDevice import NVX36, NVXDataModel, NVX_ERR_OK, NVX_ERR_ID, NVX_ERR_FAIL
+
+NVX_MODEL_36 = 4004  # модель NVX-36 (32 основных и 4 дополнительных канала)
+NVX_SIM_BUFFER_SECONDS = 4  # внутренний буфер библиотеки рассчитан на 4 секунды
+
+
+# программная замена nvxmcs.dll: те же функции, данные генерируются по часам с заданной частотой дискретизации.
+# Передаётся в NVX36/NVXSession вместо загруженной библиотеки, например NVX36(NVXSimulator())
+class NVXSimulator:
+    def __init__(self, count=1, rate=10000, serial=1000):
+        self._count = count  # количество "подключенных" устройств
+        self._rate = rate  # частота дискретизации, Гц
+        self._serial = serial  # серийный номер первого устройства
+        self._started = {}  # id -> момент NVXStart
+        self._produced = {}  # id -> сколько кадров уже выдано или потеряно
+        self.lost = 0  # кадров потеряно из-за переполнения внутреннего буфера
+
+    def NVXAPIInit(self, configuration=None):
+        return NVX_ERR_OK
+
+    def NVXAPIStop(self):
+        return NVX_ERR_OK
+
+    def NVXGetCount(self):
+        return self._count
+
+    def NVXGetId(self, number):
+        return number + 1 if number < self._count else 0
+
+    def NVXOpen(self, device_id):
+        return NVX_ERR_OK if 0 < device_id <= self._count else NVX_ERR_ID
+
+    def NVXClose(self, device_id):
+        return NVX_ERR_OK
+
+    def NVXGetInformation(self, device_id, information):
+        information._obj.Model = NVX_MODEL_36
+        information._obj.SerialNumber = self._serial + device_id - 1
+        return NVX_ERR_OK
+
+    def NVXGetProperty(self, device_id, nvx_property):
+        nvx_property._obj.RateEeg = self._rate
+        nvx_property._obj.RateAux = self._rate
+        return NVX_ERR_OK
+
+    def NVXGetPossibility(self, device_id, possibility):
+        possibility._obj.EegChannelsCount = 32
+        possibility._obj.AuxChannelsCount = 4
+        return NVX_ERR_OK
+
+    def NVXGetVersionExt(self, device_id, version):
+        return NVX_ERR_OK
+
+    def NVXGetDataMode(self, device_id, mode):
+        return NVX_ERR_OK
+
+    def NVXSetDataMode(self, device_id, mode, settings):
+        return NVX_ERR_FAIL if device_id in self._started else NVX_ERR_OK
+
+    def NVXGetSampleRateCount(self, count):
+        count._obj.value = 1
+        return NVX_ERR_OK
+
+    def NVXGetFrequencyBandwidth(self, bandwidth, size):
+        bandwidth[0].SampleRate = self._rate * 1000
+        return NVX_ERR_OK
+
+    def NVXStart(self, device_id):
+        self._started[device_id] = time.perf_counter()
+        self._produced[device_id] = 0
+        return NVX_ERR_OK
+
+    def NVXStop(self, device_id):
+        self._started.pop(device_id, None)
+        return NVX_ERR_OK
+
+    def NVXStartImpedance(self, device_id):
+        return NVX_ERR_OK if device_id in self._started else NVX_ERR_FAIL
+
+    def NVXStopImpedance(self, device_id):
+        return NVX_ERR_OK
+
+    def NVXGetImpedance(self, device_id, buffer, size):
+        for channel in range(len(buffer)):
+            buffer[channel] = 5000
+        return NVX_ERR_OK
+
+    def NVXGetData(self, device_id, buffer, size):
+        if device_id not in self._started:
+            return NVX_ERR_FAIL
+
+        due = int((time.perf_counter() - self._started[device_id]) * self._rate)
+        pending = due - self._produced[device_id]
+        # при переполнении внутреннего буфера самые старые кадры теряются - в Counter появляется разрыв
+        overflow = pending - self._rate * NVX_SIM_BUFFER_SECONDS
+        if overflow > 0:
+            self._produced[device_id] += overflow
+            self.lost += overflow
+            pending -= overflow
+
+        frames = min(pending, size.value // ctypes.sizeof(NVXDataModel))
+        data = (NVXDataModel * frames).from_address(buffer.value)
+        counter = self._produced[device_id]
+        for frame in data:
+            frame.Main[0] = int(1000 * math.sin(counter * 2 * math.pi * 10 / self._rate))
+            frame.Counter = counter & 0xFFFFFFFF
+            counter += 1
+        self._produced[device_id] = counter
+
+        return frames * ctypes.sizeof(NVXDataModel)
+
+
+def _busy():
+    # фоновая нагрузка (отображение, классификаторы)
+    while True:
+        pass
+
+
+async def _measure(args):
+    from NVXAsync import AsyncNVX36
+    from NVXRealtime import NVXRealtimeProfile
+
+    profile = None
+    if args.realtime:
+        profile = NVXRealtimeProfile(reader_cores=args.reader_cores, processing_cores=args.processing_cores,
+                                     fifo=args.fifo, lock_all=args.lock_all, hugepages=args.hugepages,
+                                     trace_allocations=args.trace)
+
+    simulator = NVXSimulator(rate=args.rate)
+    device = NVX36(simulator)
+    device.get_id()
+    device.open()
+    nvx = AsyncNVX36(device, capacity=args.rate, profile=profile, spill=args.spill)
+    # новые потоки наследуют привязку создающего потока, поэтому поток цикла событий привязывается только
+    # после создания потока чтения и потока файла подкачки
+    if profile:
+        profile.apply_processing()
+
+    # с профилем блок выделяется один раз до NVXStart и переиспользуется
+    block = profile.allocate(NVXDataModel, args.block) if profile else None
+
+    gaps = 0
+    frames = 0
+    last = None
+    stalled = False
+    await nvx.start()
+    begin = time.perf_counter()
+    async for block in nvx.stream(args.block, block):
+        for frame in block:
+            if last is not None and frame.Counter != (last + 1) & 0xFFFFFFFF:
+                gaps += 1
+            last = frame.Counter
+        frames += len(block)
+        # имитация зависшего потребителя (сборка мусора, подвисание интерфейса)
+        if args.stall and not stalled and time.perf_counter() - begin >= 1:
+            stalled = True
+            time.sleep(args.stall)
+        if nvx.running and time.perf_counter() - begin >= args.seconds:
+            await nvx.stop()
+    nvx.close()
+    device.close()
+
+    print('frames:', frames, 'counter gaps:', gaps, 'lost frames:', simulator.lost)
+    print('reader:', nvx._reader.metrics)
+    print('ring:', nvx.get_metrics())
+    if profile:
+        print('realtime:', profile.counters)
+
+
+# файл подкачки, запись в который всегда заканчивается ошибкой (диск заполнен)
+class _FullDisk:
+    def __init__(self, file):
+        self._file = file
+
+    def write(self, data):
+        raise OSError(errno.ENOSPC, os.strerror(errno.ENOSPC))
+
+    def __getattr__(self, name):
+        return getattr(self._file, name)
+
+
+async def _scenario(rate, block, seconds, stalls=(), stop_after_stall=False, full_disk=False):
+    # Функция читает устройство симулятора с файлом подкачки, останавливая потребителя на stalls
+    # (пары "момент, длительность" в секундах), и возвращает результаты проверки кадров
+    from NVXAsync import AsyncNVX36
+
+    simulator = NVXSimulator(rate=rate)
+    device = NVX36(simulator)
+    device.get_id()
+    device.open()
+    nvx = AsyncNVX36(device, capacity=rate, spill=True)
+    if full_disk:
+        nvx._spill._file = _FullDisk(nvx._spill._file)
+
+    result = {'frames': 0, 'gaps': 0, 'gap_frames': 0, 'errors': 0, 'stopped_in_segment': False}
+    last = None
+    pending = list(stalls)
+    await nvx.start()
+    begin = time.perf_counter()
+    while True:
+        try:
+            async for frames in nvx.stream(block):
+                for frame in frames:
+                    if last is not None and frame.Counter != last + 1:
+                        result['gaps'] += 1
+                        result['gap_frames'] += frame.Counter - last - 1
+                    last = frame.Counter
+                result['frames'] += len(frames)
+
+                elapsed = time.perf_counter() - begin
+                if pending and elapsed >= pending[0][0]:
+                    time.sleep(pending.pop(0)[1])
+                    if stop_after_stall and not pending:
+                        # сразу после остановки потребителя кадры ещё идут в файл
+                        result['stopped_in_segment'] = nvx.ring.spill_begin is not None and \
+                                                       nvx.ring.spill_stop is None
+                        await nvx.stop()
+                if nvx.running and elapsed >= seconds:
+                    await nvx.stop()
+            break
+        except OSError:
+            result['errors'] += 1
+    nvx.close()
+    device.close()
+
+    result['lost'] = simulator.lost
+    # всё полученное от библиотеки доставлено, кроме неполного последнего блока
+    result['undelivered'] = nvx.ring.write_pos - nvx.ring.read_pos
+    result.update(nvx.get_metrics())
+    return result
+
+
+async def _check():
+    # Функция проверяет кольцевой буфер с файлом подкачки на симуляторе и возвращает количество проваленных проверок
+    block = 100
+    checks = [
+        # потребитель стоит дольше внутреннего буфера библиотеки (4 с): без файла подкачки кадры были бы потеряны
+        ('stall longer than the library buffer', dict(rate=2000, block=block, seconds=8, stalls=[(1, 5)]),
+         lambda r: r['gaps'] == 0 and r['lost'] == 0 and r['spill_events'] >= 1 and
+         r['recovered_frames'] == r['spilled_frames']),
+        ('several spill episodes', dict(rate=2000, block=block, seconds=8, stalls=[(1, 1.5), (3.5, 1.5), (6, 1.5)]),
+         lambda r: r['gaps'] == 0 and r['spill_events'] >= 3 and r['recovered_frames'] == r['spilled_frames']),
+        ('stop() during an open segment', dict(rate=2000, block=block, seconds=10, stalls=[(1, 2)],
+                                              stop_after_stall=True),
+         lambda r: r['gaps'] == 0 and r['stopped_in_segment'] and r['undelivered'] < block and
+         r['spilled_frames'] - r['recovered_frames'] <= r['undelivered']),
+        # ошибка диска: потребитель получает её вместо вечного ожидания, потерянные кадры видны как разрыв Counter
+        ('disk full', dict(rate=2000, block=block, seconds=4, stalls=[(1, 1.5)], full_disk=True),
+         lambda r: r['errors'] == 1 and r['gaps'] == 1 and r['gap_frames'] == r['spill_lost_frames'] > 0 and
+         r['spill_unwritten_frames'] > 0),
+    ]
+
+    failed = 0
+    for name, parameters, passed in checks:
+        try:
+            result = await asyncio.wait_for(_scenario(**parameters), parameters['seconds'] + 20)
+        except asyncio.TimeoutError:
+            result, ok = 'consumer hangs', False
+        else:
+            ok = passed(result)
+        failed += not ok
+        print('[OK]  ' if ok else '[FAIL]', name, result)
+
+    return failed
+
+
+if __name__ == '__main__':
+    # измерение джиттера потока чтения на симуляторе: запуск с --realtime и без него
+    parser = argparse.ArgumentParser(description='NVX acquisition jitter measurement on the simulator')
+    parser.add_argument('--seconds', type=float, default=10)
+    parser.add_argument('--rate', type=int, default=10000)
+    parser.add_argument('--block', type=int, default=100)
+    parser.add_argument('--load', type=int, default=0, help='number of background busy processes')
+    parser.add_argument('--realtime', action='store_true')
+    parser.add_argument('--reader-cores', type=lambda value: {int(core) for core in value.split(',')})
+    parser.add_argument('--processing-cores', type=lambda value: {int(core) for core in value.split(',')})
+    parser.add_argument('--fifo', action='store_true')
+    parser.add_argument('--lock-all', action='store_true', help='lock all process memory (mlockall)')
+    parser.add_argument('--hugepages', action='store_true')
+    parser.add_argument('--trace', action='store_true', help='trace allocations after start with tracemalloc')
+    parser.add_argument('--spill', action='store_true', help='spill ring overflow to a temporary file')
+    parser.add_argument('--stall', type=float, default=0, help='consumer stall after 1 s, seconds')
+    parser.add_argument('--check', action='store_true',
+                        help='check the spill ring (stalls, several spills, stop, disk error), exit code 1 on failure')
+    args = parser.parse_args()
+
+    if args.check:
+        sys.exit(1 if asyncio.run(_check()) else 0)
+
+    workers = [multiprocessing.Process(target=_busy, daemon=True) for _ in range(args.load)]
+    for worker in workers:
+        worker.start()
+    asyncio.run(_measure(args))
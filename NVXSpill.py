@@ -0,0 +1,146 @@
+import ctypes
+import queue
+import tempfile
+import threading
+
+from NVXDevice import NVXDataModel
+
+_LOAD = object()  # команда потоку файла: подгрузить следующие кадры в кольцо упреждающего чтения
+_BEGIN = object()  # команда потоку файла: начать новый сегмент с заданного кадра
+
+
+# временный файл для кадров, не поместившихся в кольцевой буфер. Поток чтения только ставит заполненные
+# блоки в очередь; запись на диск и упреждающее чтение обратно в память выполняет отдельный поток,
+# поэтому ни опрос устройств, ни цикл событий не ждут диска
+class NVXSpill(threading.Thread):
+    def __init__(self, on_ready, capacity, chunk_frames=1024, chunks=16, directory=None, profile=None):
+        super().__init__(name='NVXSpill', daemon=True)
+        self.chunk_frames = chunk_frames  # размер блока записи, кадров
+        self._on_ready = on_ready  # вызывается из потока файла, когда в памяти появились новые кадры
+        self._queue = queue.SimpleQueue()  # команды потоку файла
+
+        # блоки записи и кольцо упреждающего чтения выделяются заранее, чтобы после NVXStart не было выделений
+        allocate = profile.allocate if profile else lambda ctype, count: (ctype * count)()
+        self.chunks = [allocate(NVXDataModel, chunk_frames) for _ in range(chunks)]
+        self._views = [memoryview((ctypes.c_char * ctypes.sizeof(chunk)).from_buffer(chunk)) for chunk in self.chunks]
+        self.free = queue.SimpleQueue()  # номера свободных блоков записи
+        for index in range(chunks):
+            self.free.put(index)
+
+        self._capacity = capacity  # ёмкость кольца упреждающего чтения, кадров (не меньше блока потребителя)
+        self._ahead = allocate(NVXDataModel, capacity)
+        self._ahead_view = memoryview((ctypes.c_char * ctypes.sizeof(self._ahead)).from_buffer(self._ahead))
+
+        self._base = 0  # номер кадра, записанного в начало файла (начало текущего сегмента)
+        self.end = 0  # номер кадра, до которого все кадры уже записаны в файл
+        self.ready_end = 0  # номер кадра, до которого кадры прочитаны из файла в память (двигает поток файла)
+        self.taken = 0  # номер кадра, до которого потребитель забрал кадры из памяти (двигает потребитель)
+        self.error = None  # ошибка диска (OSError); после неё файл больше не используется
+        self.unwritten_frames = 0  # кадров, которые не удалось записать в файл
+        self._load_failed = False  # ошибка при чтении из файла: кадры после ready_end уже не появятся
+
+        # файл без имени (POSIX) или удаляемый при закрытии (Windows) не останется на диске после падения процесса.
+        # Пишет и читает только поток файла, поэтому хватает одного дескриптора с явным seek
+        self._file = tempfile.TemporaryFile(prefix='nvx_spill_', dir=directory, buffering=0)
+
+        self.start()
+
+    def begin(self, first):
+        # вызывается из потока чтения: новый сегмент начинается с кадра first (предыдущий уже прочитан)
+        self._queue.put((_BEGIN, first))
+
+    def put(self, index, frames, end):
+        # вызывается из потока чтения: блок index (frames кадров) дописать в файл, end - номер кадра после него
+        self._queue.put((index, frames, end))
+
+    def take(self, block, first, position, count):
+        # вызывается потребителем: count кадров, начиная с кадра position, из памяти в block (с кадра first)
+        size = ctypes.sizeof(NVXDataModel)
+        offset = position % self._capacity
+        part = min(count, self._capacity - offset)
+        ctypes.memmove(ctypes.byref(block, first * size), ctypes.byref(self._ahead, offset * size), part * size)
+        if count > part:
+            ctypes.memmove(ctypes.byref(block, (first + part) * size), self._ahead, (count - part) * size)
+        self.taken = position + count
+        # место в кольце освободилось - поток файла подгрузит следующие кадры
+        self._queue.put(_LOAD)
+
+    def exhausted(self) -> bool:
+        # после ошибки диска: все кадры, которые ещё можно было получить из файла, уже в памяти
+        return self.error is not None and (self._load_failed or self.ready_end >= self.end)
+
+    def run(self):
+        size = ctypes.sizeof(NVXDataModel)
+        while True:
+            item = self._queue.get()
+            if item is None:
+                return
+
+            if item is not _LOAD:
+                if item[0] is _BEGIN:
+                    self._base = self.end = self.ready_end = self.taken = item[1]
+                    # предыдущий сегмент прочитан - файл не должен расти от сегмента к сегменту
+                    if self.error is None:
+                        try:
+                            self._file.truncate(0)
+                        except OSError as error:
+                            self._fail(error)
+                    continue
+
+                index, frames, end = item
+                if self.error is None:
+                    try:
+                        view = self._views[index][:frames * size]
+                        self._file.seek((end - frames - self._base) * size)
+                        while len(view):
+                            view = view[self._file.write(view):]
+                        self.end = end
+                    except OSError as error:
+                        self._fail(error)
+                if self.error is not None:
+                    self.unwritten_frames += frames
+                # блок возвращается в пул и после ошибки, иначе поток чтения остановится на пустом пуле
+                self.free.put(index)
+
+            if not self._load_failed:
+                try:
+                    self._load()
+                except OSError as error:
+                    self._load_failed = True
+                    self._fail(error)
+
+    def _fail(self, error):
+        # поток файла не завершается: он продолжает возвращать блоки в пул, а потребитель получит ошибку
+        if self.error is None:
+            print('[ERROR] spill file failed, spilling is disabled:', error)
+            self.error = error
+        self._on_ready()
+
+    def _load(self):
+        # читаем записанные кадры в свободную часть кольца упреждающего чтения
+        size = ctypes.sizeof(NVXDataModel)
+        loaded = False
+        while True:
+            count = min(self.end - self.ready_end, self._capacity - (self.ready_end - self.taken))
+            if count <= 0:
+                break
+
+            offset = self.ready_end % self._capacity
+            count = min(count, self._capacity - offset)
+            view = self._ahead_view[offset * size:(offset + count) * size]
+            self._file.seek((self.ready_end - self._base) * size)
+            while len(view):
+                read = self._file.readinto(view)
+                if not read:
+                    raise OSError('spill file is shorter than expected')
+                view = view[read:]
+            self.ready_end += count
+            loaded = True
+
+        if loaded:
+            self._on_ready()
+
+    def close(self):
+        self._queue.put(None)
+        self.join()
+        self._file.close()